@@ -15,6 +15,7 @@
 
 #include <utils.h>
 #include <route_analysis/route_utils.h>
+#include <route_analysis/activity_aggregates.h>
 
 using json = nlohmann::json;
 
@@ -97,6 +98,42 @@ void getAthleteActivities(httplib::Client& client, httplib::Headers& headers, in
     }
 }
 
+/** folds only activities not yet in the saved aggregate state, then writes per-scope weekly trends
+ *  the state is rebuilt from all activities when it is unreadable or the routes file was regenerated */
+void writeWeeklyTrends(const std::string& activityPath, const std::string& routesPath, const std::string& statePath, const std::string& outPath, int numWeeks=12) {
+    using namespace ActivityAggregates;
+    auto saved = Aggregator::loadFromFile(statePath);
+    Aggregator aggregator = saved ? *saved : Aggregator{};
+
+    json routes = json::object();
+    std::ifstream routesFile(routesPath);
+    if (routesFile) {
+        routesFile >> routes;
+    }
+    if (!aggregator.addRoutes(routes)) {
+        PLOGD << "routes changed since aggregate state was saved, rebuilding";
+        aggregator = Aggregator{routes};
+    }
+
+    aggregator.loadActivities(activityPath);
+    aggregator.saveToFile(statePath);
+
+    auto latest = aggregator.latestStart();
+    if (!latest) return;
+
+    // calendar weeks up to and including the one holding the latest activity
+    json trends {};
+    for (const auto& scope : aggregator.scopes()) {
+        trends[scope] = aggregator.weeklyTrend(scope, numWeeks, *latest);
+    }
+
+    std::ofstream outFile(outPath);
+    if (outFile.is_open()) {
+        outFile << trends.dump(2);
+        outFile.close();
+    }
+}
+
 
 int main(int, char**){
     plog::init(plog::debug, "Logfile.txt");
@@ -123,4 +160,6 @@ int main(int, char**){
         out << rJson.dump(2);
         out.close();
     }
+
+    writeWeeklyTrends("json_data/activity_data_iris.json", "test_distinct_routes.json", "activity_aggregates_iris.json", "weekly_trends_iris.json");
 }
@@ -0,0 +1,518 @@
+#include "activity_aggregates.h"
+#include <nlohmann/json.hpp>
+#include <plog/Log.h>
+
+#include <fstream>
+#include <filesystem>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+
+namespace ActivityAggregates {
+    constexpr std::int64_t secondsPerDay = 86400;
+    constexpr std::int64_t secondsPerWeek = 7 * secondsPerDay;
+
+    const std::array<std::pair<Granularity, const char*>, 3> granularityNames =
+        {{{Granularity::Day, "day"}, {Granularity::Week, "week"}, {Granularity::Month, "month"}}};
+
+    const std::array<std::string, 10> metrics =
+        {"average_cadence", "average_heartrate", "average_speed", "elev_high", "elev_low",
+            "max_heartrate", "max_speed", "total_elevation_gain", "distance", "moving_time"};
+
+    QuantileSketch::QuantileSketch(double accuracy)
+        : m_accuracy(accuracy), m_gamma((1.0 + accuracy) / (1.0 - accuracy)), m_logGamma(std::log(m_gamma)) {}
+
+    int QuantileSketch::keyFor(double magnitude) const {
+        return static_cast<int>(std::ceil(std::log(magnitude) / m_logGamma));
+    }
+
+    double QuantileSketch::valueFor(int key) const {
+        // midpoint of (gamma^(key-1), gamma^key] in relative terms
+        return 2.0 * std::pow(m_gamma, key) / (m_gamma + 1.0);
+    }
+
+    void QuantileSketch::add(double value) {
+        if (value > 0.0) {
+            ++m_positive[keyFor(value)];
+        } else if (value < 0.0) {
+            ++m_negative[keyFor(-value)];
+        } else {
+            ++m_zeros;
+        }
+        ++m_count;
+    }
+
+    void QuantileSketch::merge(const QuantileSketch& other) {
+        if (other.m_gamma != m_gamma) {
+            throw std::invalid_argument("cannot merge quantile sketches with different accuracies");
+        }
+        for (const auto& [key, n] : other.m_positive) m_positive[key] += n;
+        for (const auto& [key, n] : other.m_negative) m_negative[key] += n;
+        m_zeros += other.m_zeros;
+        m_count += other.m_count;
+    }
+
+    double QuantileSketch::quantile(double q) const {
+        if (m_count == 0) return 0.0;
+        q = std::clamp(q, 0.0, 1.0);
+        auto rank = static_cast<std::int64_t>(q * static_cast<double>(m_count - 1));
+
+        // walk values in ascending order: large negatives, zeros, then positives
+        std::int64_t seen = 0;
+        for (auto it = m_negative.rbegin(); it != m_negative.rend(); ++it) {
+            seen += it->second;
+            if (seen > rank) return -valueFor(it->first);
+        }
+        seen += m_zeros;
+        if (seen > rank) return 0.0;
+        for (const auto& [key, n] : m_positive) {
+            seen += n;
+            if (seen > rank) return valueFor(key);
+        }
+        return m_positive.empty() ? 0.0 : valueFor(m_positive.rbegin()->first);
+    }
+
+    json QuantileSketch::toJson() const {
+        return {
+            {"accuracy", m_accuracy},
+            {"positive", m_positive},
+            {"negative", m_negative},
+            {"zeros", m_zeros},
+            {"count", m_count}
+        };
+    }
+
+    QuantileSketch QuantileSketch::fromJson(const json& j) {
+        QuantileSketch sketch {j.at("accuracy").get<double>()};
+        sketch.m_positive = j.at("positive").get<std::map<int, std::int64_t>>();
+        sketch.m_negative = j.at("negative").get<std::map<int, std::int64_t>>();
+        sketch.m_zeros = j.at("zeros").get<std::int64_t>();
+        sketch.m_count = j.at("count").get<std::int64_t>();
+        return sketch;
+    }
+
+    void MetricStats::add(double value) {
+        if (count == 0) {
+            min = value;
+            max = value;
+        } else {
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        ++count;
+        sum += value;
+        sketch.add(value);
+    }
+
+    void MetricStats::merge(const MetricStats& other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            min = other.min;
+            max = other.max;
+        } else {
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+        count += other.count;
+        sum += other.sum;
+        sketch.merge(other.sketch);
+    }
+
+    json MetricStats::summary() const {
+        // sketch estimates are clamped to the exact extremes
+        auto percentile = [&](double q) { return std::clamp(sketch.quantile(q), min, max); };
+        return {
+            {"count", count},
+            {"mean", count > 0 ? sum / static_cast<double>(count) : 0.0},
+            {"min", min},
+            {"max", max},
+            {"p50", percentile(0.5)},
+            {"p90", percentile(0.9)},
+            {"p99", percentile(0.99)}
+        };
+    }
+
+    json MetricStats::toJson() const {
+        return {
+            {"count", count},
+            {"sum", sum},
+            {"min", min},
+            {"max", max},
+            {"sketch", sketch.toJson()}
+        };
+    }
+
+    MetricStats MetricStats::fromJson(const json& j) {
+        MetricStats stats {};
+        stats.count = j.at("count").get<std::int64_t>();
+        stats.sum = j.at("sum").get<double>();
+        stats.min = j.at("min").get<double>();
+        stats.max = j.at("max").get<double>();
+        stats.sketch = QuantileSketch::fromJson(j.at("sketch"));
+        if (stats.sketch.accuracy() != QuantileSketch::defaultAccuracy) {
+            throw std::invalid_argument("saved sketch accuracy does not match the default");
+        }
+        return stats;
+    }
+
+    void Bucket::merge(const Bucket& other) {
+        numActivities += other.numActivities;
+        for (const auto& [metric, stats] : other.metrics) {
+            metrics[metric].merge(stats);
+        }
+    }
+
+    json Bucket::summary() const {
+        json out {};
+        out["num_activities"] = numActivities;
+        out["metrics"] = json::object();
+        for (const auto& [metric, stats] : metrics) {
+            out["metrics"][metric] = stats.summary();
+        }
+        return out;
+    }
+
+    json Bucket::toJson() const {
+        json out {};
+        out["num_activities"] = numActivities;
+        out["metrics"] = json::object();
+        for (const auto& [metric, stats] : metrics) {
+            out["metrics"][metric] = stats.toJson();
+        }
+        return out;
+    }
+
+    Bucket Bucket::fromJson(const json& j) {
+        Bucket bucket {};
+        bucket.numActivities = j.at("num_activities").get<std::int64_t>();
+        for (const auto& [metric, stats] : j.at("metrics").items()) {
+            bucket.metrics[metric] = MetricStats::fromJson(stats);
+        }
+        return bucket;
+    }
+
+    std::optional<std::int64_t> parseStartDate(const std::string& date) {
+        int y {}, mo {}, d {}, h {}, mi {}, s {};
+        if (std::sscanf(date.c_str(), "%d-%d-%dT%d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6) {
+            return {};
+        }
+
+        if (mo < 1 || mo > 12 || d < 1 || d > 31) return {};
+        if (h < 0 || h >= 24 || mi < 0 || mi >= 60 || s < 0 || s >= 61) return {};
+
+        std::chrono::year_month_day ymd {std::chrono::year{y}, std::chrono::month(mo), std::chrono::day(d)};
+        if (!ymd.ok()) return {};
+
+        auto days = std::chrono::sys_days{ymd}.time_since_epoch().count();
+        return static_cast<std::int64_t>(days) * secondsPerDay + h * 3600 + mi * 60 + s;
+    }
+
+    std::optional<std::int64_t> localStartTime(const json& activity) {
+        if (activity.contains("start_date_local") && activity["start_date_local"].is_string()) {
+            return parseStartDate(activity["start_date_local"].get<std::string>());
+        }
+        if (activity.contains("start_date") && activity["start_date"].is_string()) {
+            auto start = parseStartDate(activity["start_date"].get<std::string>());
+            if (start && activity.contains("utc_offset") && activity["utc_offset"].is_number()) {
+                *start += static_cast<std::int64_t>(activity["utc_offset"].get<double>());
+            }
+            return start;
+        }
+        return {};
+    }
+
+    std::int64_t bucketStart(std::int64_t localTime, Granularity granularity) {
+        using namespace std::chrono;
+        sys_days day = floor<days>(sys_seconds{seconds{localTime}});
+
+        switch (granularity) {
+            case Granularity::Week: {
+                // iso weekday: monday = 1, sunday = 7
+                unsigned offset = weekday{day}.iso_encoding() - 1;
+                day -= days{offset};
+                break;
+            }
+            case Granularity::Month: {
+                year_month_day ymd {day};
+                day = sys_days{ymd.year() / ymd.month() / 1};
+                break;
+            }
+            case Granularity::Day:
+                break;
+        }
+        return static_cast<std::int64_t>(day.time_since_epoch().count()) * secondsPerDay;
+    }
+
+    Aggregator::Aggregator(const json& routes) {
+        addRoutes(routes);
+    }
+
+    bool Aggregator::addRoutes(const json& routes) {
+        std::unordered_map<std::int64_t, std::int64_t> routeIds;
+        for (json::const_iterator sport = routes.begin(); sport != routes.end(); ++sport) {
+            for (const json& route : sport.value()) {
+                if (!route.contains("ids") || !route.contains("route_id")) continue;
+                for (const auto& id : route["ids"]) {
+                    routeIds[id.get<std::int64_t>()] = route["route_id"].get<std::int64_t>();
+                }
+            }
+        }
+
+        // history of folded activities already sits under their old route scope (or none)
+        for (const auto& [activityId, routeId] : routeIds) {
+            if (!m_seenIds.contains(activityId)) continue;
+            auto existing = m_routeIds.find(activityId);
+            if (existing == m_routeIds.end() || existing->second != routeId) {
+                PLOGD << "route mapping changed for aggregated activity: " << activityId;
+                return false;
+            }
+        }
+
+        for (const auto& [activityId, routeId] : routeIds) {
+            m_routeIds[activityId] = routeId;
+        }
+        return true;
+    }
+
+    bool Aggregator::addActivity(const json& activity) {
+        if (!activity.contains("id") || !activity["id"].is_number_integer()) {
+            PLOGD << "activity missing integer id: " << (activity.contains("id") ? activity["id"] : json{});
+            return false;
+        }
+        std::int64_t id = activity["id"].get<std::int64_t>();
+        if (m_seenIds.contains(id)) {
+            PLOGD << "activity already aggregated: " << id;
+            return false;
+        }
+
+        auto start = localStartTime(activity);
+        if (!start) {
+            PLOGD << "activity missing usable start date: " << id;
+            return false;
+        }
+
+        Bucket sample {};
+        sample.numActivities = 1;
+        for (const std::string& metric : metrics) {
+            if (activity.contains(metric) && activity[metric].is_number()) {
+                sample.metrics[metric].add(activity[metric].get<double>());
+            }
+        }
+
+        std::vector<std::string> activityScopes;
+        if (activity.contains("sport_type") && activity["sport_type"].is_string()) {
+            activityScopes.push_back("sport:" + activity["sport_type"].get<std::string>());
+        }
+        auto route = m_routeIds.find(id);
+        if (route != m_routeIds.end()) {
+            activityScopes.push_back("route:" + std::to_string(route->second));
+        }
+
+        for (const auto& scope : activityScopes) {
+            for (Granularity granularity : {Granularity::Day, Granularity::Week, Granularity::Month}) {
+                m_series[scope][granularity][bucketStart(*start, granularity)].merge(sample);
+            }
+        }
+
+        m_seenIds.insert(id);
+        if (!m_latestStart || *start > *m_latestStart) {
+            m_latestStart = start;
+        }
+        return true;
+    }
+
+    int Aggregator::addActivities(const json& activities) {
+        if (!activities.is_array()) return 0;
+
+        int added = 0;
+        for (const auto& activity : activities) {
+            if (addActivity(activity)) ++added;
+        }
+        return added;
+    }
+
+    bool Aggregator::loadActivities(const std::string& path) {
+        std::ifstream inFile(path);
+        if (!inFile) {
+            PLOGD << "unable to open activity data file: " << path;
+            return false;
+        }
+        json j;
+        inFile >> j;
+        inFile.close();
+
+        if (!j.contains("data") || !j["data"].is_array()) return false;
+
+        int added = addActivities(j["data"]);
+        PLOGD << "aggregated " << added << " new activities from " << path;
+        return true;
+    }
+
+    json Aggregator::query(const std::string& scope, Granularity granularity, std::int64_t localFrom, std::int64_t localTo) const {
+        json out = json::array();
+        auto scopeIt = m_series.find(scope);
+        if (scopeIt == m_series.end()) return out;
+        auto seriesIt = scopeIt->second.find(granularity);
+        if (seriesIt == scopeIt->second.end()) return out;
+
+        const Series& series = seriesIt->second;
+        for (auto it = series.lower_bound(bucketStart(localFrom, granularity)); it != series.end() && it->first < localTo; ++it) {
+            json bucket = it->second.summary();
+            bucket["start"] = it->first;
+            out.push_back(bucket);
+        }
+        return out;
+    }
+
+    json Aggregator::rolling(const std::string& scope, int numDays, std::int64_t localEnd) const {
+        if (numDays <= 0) {
+            throw std::invalid_argument("rolling window needs a positive number of days");
+        }
+
+        Bucket window {};
+        std::int64_t last = bucketStart(localEnd, Granularity::Day);
+        std::int64_t first = last - static_cast<std::int64_t>(numDays - 1) * secondsPerDay;
+
+        auto scopeIt = m_series.find(scope);
+        if (scopeIt != m_series.end()) {
+            auto seriesIt = scopeIt->second.find(Granularity::Day);
+            if (seriesIt != scopeIt->second.end()) {
+                const Series& series = seriesIt->second;
+                for (auto it = series.lower_bound(first); it != series.end() && it->first <= last; ++it) {
+                    window.merge(it->second);
+                }
+            }
+        }
+
+        json out = window.summary();
+        out["start"] = first;
+        out["end"] = last + secondsPerDay;
+        return out;
+    }
+
+    json Aggregator::rollingSeries(const std::string& scope, int numDays, int numWindows, std::int64_t localEnd) const {
+        if (numDays <= 0 || numWindows <= 0) {
+            throw std::invalid_argument("rolling series needs a positive number of days and windows");
+        }
+
+        json out = json::array();
+        for (int i = 0; i < numWindows; ++i) {
+            out.push_back(rolling(scope, numDays, localEnd - static_cast<std::int64_t>(i) * numDays * secondsPerDay));
+        }
+        return out;
+    }
+
+    json Aggregator::weeklyTrend(const std::string& scope, int numWeeks, std::int64_t localEnd) const {
+        if (numWeeks <= 0) {
+            throw std::invalid_argument("weekly trend needs a positive number of weeks");
+        }
+
+        std::int64_t lastWeek = bucketStart(localEnd, Granularity::Week);
+        std::int64_t from = lastWeek - static_cast<std::int64_t>(numWeeks - 1) * secondsPerWeek;
+        return query(scope, Granularity::Week, from, lastWeek + secondsPerWeek);
+    }
+
+    std::vector<std::string> Aggregator::scopes() const {
+        std::vector<std::string> out;
+        for (const auto& [scope, _] : m_series) {
+            out.push_back(scope);
+        }
+        return out;
+    }
+
+    json Aggregator::toJson() const {
+        json out {};
+        out["seen_ids"] = json(std::vector<std::int64_t>(m_seenIds.begin(), m_seenIds.end()));
+        out["route_ids"] = json(std::map<std::int64_t, std::int64_t>(m_routeIds.begin(), m_routeIds.end()));
+        out["latest_start"] = m_latestStart ? json(*m_latestStart) : json(nullptr);
+
+        out["series"] = json::object();
+        for (const auto& [scope, granularities] : m_series) {
+            json jScope = json::object();
+            for (const auto& [granularity, name] : granularityNames) {
+                auto seriesIt = granularities.find(granularity);
+                if (seriesIt == granularities.end()) continue;
+
+                json buckets = json::array();
+                for (const auto& [start, bucket] : seriesIt->second) {
+                    json jBucket = bucket.toJson();
+                    jBucket["start"] = start;
+                    buckets.push_back(jBucket);
+                }
+                jScope[name] = buckets;
+            }
+            out["series"][scope] = jScope;
+        }
+        return out;
+    }
+
+    Aggregator Aggregator::fromJson(const json& j) {
+        Aggregator aggregator {};
+        for (const auto& id : j.at("seen_ids")) {
+            aggregator.m_seenIds.insert(id.get<std::int64_t>());
+        }
+        for (const auto& [activityId, routeId] : j.at("route_ids").get<std::map<std::int64_t, std::int64_t>>()) {
+            aggregator.m_routeIds[activityId] = routeId;
+        }
+        if (j.at("latest_start").is_number_integer()) {
+            aggregator.m_latestStart = j["latest_start"].get<std::int64_t>();
+        }
+
+        for (const auto& [scope, jScope] : j.at("series").items()) {
+            for (const auto& [granularity, name] : granularityNames) {
+                if (!jScope.contains(name)) continue;
+
+                Series& series = aggregator.m_series[scope][granularity];
+                for (const auto& jBucket : jScope[name]) {
+                    series[jBucket.at("start").get<std::int64_t>()] = Bucket::fromJson(jBucket);
+                }
+            }
+        }
+        return aggregator;
+    }
+
+    bool Aggregator::saveToFile(const std::string& path) const {
+        const std::string tmpPath = path + ".tmp";
+        std::ofstream outFile(tmpPath);
+        if (!outFile.is_open()) {
+            PLOGD << "error opening aggregate state file: " << tmpPath;
+            return false;
+        }
+        outFile << toJson().dump();
+        outFile.close();
+        if (!outFile) {
+            PLOGD << "error writing aggregate state file: " << tmpPath;
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            PLOGD << "error replacing aggregate state file: " << ec.message();
+            return false;
+        }
+        return true;
+    }
+
+    std::optional<Aggregator> Aggregator::loadFromFile(const std::string& path) {
+        std::ifstream inFile(path);
+        if (!inFile) {
+            PLOGD << "no aggregate state file: " << path;
+            return {};
+        }
+        try {
+            json j;
+            inFile >> j;
+            return fromJson(j);
+        } catch (const json::exception& e) {
+            PLOGD << "invalid aggregate state file " << path << ": " << e.what();
+        } catch (const std::invalid_argument& e) {
+            PLOGD << "incompatible aggregate state file " << path << ": " << e.what();
+        }
+        return {};
+    }
+}
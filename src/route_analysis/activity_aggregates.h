@@ -0,0 +1,163 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+#ifndef ACTIVITY_AGGREGATES
+#define ACTIVITY_AGGREGATES
+
+using json = nlohmann::json;
+
+/**
+ * All times here are "local seconds": the athlete's wall-clock time counted in seconds from
+ * 1970-01-01T00:00 with no zone applied (what strava reports as start_date_local).
+ * To query relative to a real instant, add the athlete's utc offset to the unix time first.
+ */
+namespace ActivityAggregates {
+    enum class Granularity { Day, Week, Month };
+
+    /** Mergeable quantile sketch with log-spaced buckets (relative error bounded by accuracy) */
+    class QuantileSketch {
+    public:
+        static constexpr double defaultAccuracy = 0.01;
+
+        explicit QuantileSketch(double accuracy=defaultAccuracy);
+
+        void add(double value);
+
+        // throws std::invalid_argument if the sketches were built with different accuracies
+        void merge(const QuantileSketch& other);
+        double quantile(double q) const;
+        std::int64_t count() const { return m_count; }
+        double accuracy() const { return m_accuracy; }
+
+        json toJson() const;
+        static QuantileSketch fromJson(const json& j);
+
+    private:
+        int keyFor(double magnitude) const;
+        double valueFor(int key) const;
+
+        double m_accuracy;
+        double m_gamma;
+        double m_logGamma;
+        std::map<int, std::int64_t> m_positive;
+        std::map<int, std::int64_t> m_negative;
+        std::int64_t m_zeros {};
+        std::int64_t m_count {};
+    };
+
+    struct MetricStats {
+        std::int64_t count {};
+        double sum {};
+        double min {};
+        double max {};
+        QuantileSketch sketch {};
+
+        void add(double value);
+        void merge(const MetricStats& other);
+
+        // mean, min, max and percentiles for reports
+        json summary() const;
+
+        json toJson() const;
+
+        // throws std::invalid_argument if the saved sketch accuracy is not the default
+        static MetricStats fromJson(const json& j);
+    };
+
+    struct Bucket {
+        std::int64_t numActivities {};
+        std::map<std::string, MetricStats> metrics;
+
+        void merge(const Bucket& other);
+        json summary() const;
+
+        json toJson() const;
+        static Bucket fromJson(const json& j);
+    };
+
+    /**
+     * Per-route and per-sport statistics bucketed by activity start time.
+     * Activities are folded in as they arrive; queries only touch the buckets in range.
+     * Scopes are named "sport:<sport_type>" and "route:<route_id>".
+     * State can be saved and restored so each run only folds activities it has not seen.
+     * Route scopes are only valid while the routes file they were built from is stable,
+     * since RouteUtils::getRoutes draws fresh route ids on every run.
+     */
+    class Aggregator {
+    public:
+        Aggregator() = default;
+
+        // map activity ids to route ids using the output of RouteUtils::getRoutes
+        explicit Aggregator(const json& routes);
+
+        // add activity id -> route id mappings, keeping existing ones for ids not in routes
+        // returns false and changes nothing if an already folded activity would be (re)mapped,
+        // in which case the caller should rebuild from a fresh Aggregator and the full activity data
+        bool addRoutes(const json& routes);
+
+        // fold a single strava activity into every scope it belongs to
+        // returns false if it has no integer id, was already folded in, or has no usable start date
+        bool addActivity(const json& activity);
+
+        // fold an array of activities, returns the number added (already seen ids are skipped)
+        int addActivities(const json& activities);
+
+        // fold the activities in an activity data file (as written by getAthleteActivities)
+        bool loadActivities(const std::string& path);
+
+        // calendar buckets (local seconds of bucket start -> stats) overlapping [localFrom, localTo)
+        json query(const std::string& scope, Granularity granularity, std::int64_t localFrom, std::int64_t localTo) const;
+
+        // stats merged over the numDays calendar days ending on the day containing localEnd
+        // throws std::invalid_argument if numDays <= 0
+        json rolling(const std::string& scope, int numDays, std::int64_t localEnd) const;
+
+        // numWindows consecutive rolling windows of numDays, stepping back from localEnd, newest first
+        // throws std::invalid_argument if numDays <= 0 or numWindows <= 0
+        json rollingSeries(const std::string& scope, int numDays, int numWindows, std::int64_t localEnd) const;
+
+        // the numWeeks calendar weeks up to and including the one containing localEnd, oldest first
+        // throws std::invalid_argument if numWeeks <= 0
+        json weeklyTrend(const std::string& scope, int numWeeks, std::int64_t localEnd) const;
+
+        std::vector<std::string> scopes() const;
+
+        // local start time of the newest activity folded in
+        std::optional<std::int64_t> latestStart() const { return m_latestStart; }
+
+        json toJson() const;
+        static Aggregator fromJson(const json& j);
+
+        // writes to a temporary file and renames it over path, so an interrupted save keeps the old state
+        bool saveToFile(const std::string& path) const;
+
+        // empty if the file is missing, unreadable or not valid aggregate state
+        static std::optional<Aggregator> loadFromFile(const std::string& path);
+
+    private:
+        using Series = std::map<std::int64_t, Bucket>;
+
+        std::unordered_map<std::int64_t, std::int64_t> m_routeIds;
+        std::unordered_set<std::int64_t> m_seenIds;
+        std::optional<std::int64_t> m_latestStart;
+        std::map<std::string, std::map<Granularity, Series>> m_series;
+    };
+
+    // parse an ISO 8601 timestamp such as "2024-03-02T17:04:11Z" to seconds since 1970-01-01T00:00
+    // any zone suffix is ignored, so the result is in whatever zone the string was written in
+    std::optional<std::int64_t> parseStartDate(const std::string& date);
+
+    // local start time of an activity: start_date_local, else start_date shifted by utc_offset
+    std::optional<std::int64_t> localStartTime(const json& activity);
+
+    // local seconds of the start of the calendar bucket (weeks start on Monday) containing localTime
+    std::int64_t bucketStart(std::int64_t localTime, Granularity granularity);
+}
+
+#endif
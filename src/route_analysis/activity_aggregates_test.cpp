@@ -0,0 +1,205 @@
+#include "activity_aggregates.h"
+#include <nlohmann/json.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cmath>
+#include <stdexcept>
+
+using namespace ActivityAggregates;
+
+namespace {
+    int failures = 0;
+
+    void check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << '\n';
+            ++failures;
+        }
+    }
+
+    bool withinRelative(double estimate, double expected, double accuracy) {
+        return std::abs(estimate - expected) <= accuracy * std::abs(expected) + 1e-9;
+    }
+
+    json makeActivity(std::int64_t id, const std::string& startLocal, double distance, const std::string& sport="Run") {
+        return {
+            {"id", id},
+            {"sport_type", sport},
+            {"start_date_local", startLocal},
+            {"distance", distance}
+        };
+    }
+
+    void testSketch() {
+        QuantileSketch whole {};
+        QuantileSketch low {};
+        QuantileSketch high {};
+        for (int i = 1; i <= 10000; ++i) {
+            whole.add(i);
+            (i <= 5000 ? low : high).add(i);
+        }
+        low.merge(high);
+
+        for (double q : {0.01, 0.25, 0.5, 0.9, 0.99}) {
+            double expected = std::floor(q * 9999) + 1;
+            check(withinRelative(whole.quantile(q), expected, 0.01), "sketch quantile within 1% at q=" + std::to_string(q));
+            check(low.quantile(q) == whole.quantile(q), "merged sketch matches single sketch at q=" + std::to_string(q));
+        }
+
+        QuantileSketch mixed {};
+        for (double v : {-50.0, -5.0, 0.0, 0.0, 5.0}) mixed.add(v);
+        check(withinRelative(mixed.quantile(0.0), -50.0, 0.01), "sketch orders large negatives first");
+        check(mixed.quantile(0.5) == 0.0, "sketch median lands on zeros");
+        check(withinRelative(mixed.quantile(1.0), 5.0, 0.01), "sketch max is the largest positive");
+
+        auto restored = QuantileSketch::fromJson(whole.toJson());
+        check(restored.quantile(0.9) == whole.quantile(0.9), "sketch survives json round trip");
+
+        QuantileSketch coarse {0.1};
+        coarse.add(1000.0);
+        bool threw = false;
+        try { whole.merge(coarse); } catch (const std::invalid_argument&) { threw = true; }
+        check(threw, "merge rejects sketches with different accuracies");
+    }
+
+    void testCalendar() {
+        check(parseStartDate("2024-03-02T17:04:11Z") == 1709399051, "parses iso timestamp");
+        check(!parseStartDate("2024-03-04T99:99:99Z"), "rejects out of range time");
+        check(!parseStartDate("2023-02-29T00:00:00Z"), "rejects invalid date");
+        check(!parseStartDate("2024-257-01T00:00:00Z"), "rejects out of range month");
+        check(!parseStartDate("2024-01-288T00:00:00Z"), "rejects out of range day");
+        check(!parseStartDate("yesterday"), "rejects garbage");
+
+        // 2024-03-03 is a sunday, its week starts monday 2024-02-26
+        std::int64_t sunday = *parseStartDate("2024-03-03T23:59:59Z");
+        check(bucketStart(sunday, Granularity::Day) == *parseStartDate("2024-03-03T00:00:00Z"), "day bucket");
+        check(bucketStart(sunday, Granularity::Week) == *parseStartDate("2024-02-26T00:00:00Z"), "week bucket starts monday");
+        check(bucketStart(sunday + 1, Granularity::Week) == *parseStartDate("2024-03-04T00:00:00Z"), "monday starts a new week");
+        check(bucketStart(sunday, Granularity::Month) == *parseStartDate("2024-03-01T00:00:00Z"), "month bucket");
+        check(bucketStart(*parseStartDate("1969-12-31T12:00:00Z"), Granularity::Day) == -86400, "day bucket before epoch");
+    }
+
+    void testAggregator() {
+        Aggregator aggregator {json{{"Run", {{{"route_id", 42}, {"ids", {1, 2}}, {"polyline", ""}}}}}};
+
+        check(aggregator.addActivity(makeActivity(1, "2024-03-04T07:00:00Z", 5000)), "adds activity");
+        check(!aggregator.addActivity(makeActivity(1, "2024-03-04T07:00:00Z", 5000)), "rejects duplicate id");
+        check(!aggregator.addActivity({{"id", "abc"}, {"start_date_local", "2024-03-04T07:00:00Z"}}), "rejects non-integer id without throwing");
+        check(!aggregator.addActivity({{"id", 9}, {"start_date_local", nullptr}}), "rejects activity with no start date");
+
+        // null local date falls back to start_date shifted by utc_offset (17:30Z - 8h is the same day)
+        json fallback = {{"id", 2}, {"sport_type", "Run"}, {"start_date_local", nullptr},
+            {"start_date", "2024-03-10T17:30:00Z"}, {"utc_offset", -28800.0}, {"distance", 10000.0}};
+        check(aggregator.addActivity(fallback), "falls back to start_date");
+        check(aggregator.addActivity(makeActivity(3, "2024-02-26T00:00:00Z", 3000)), "adds activity on week boundary");
+
+        std::int64_t day = 86400;
+        std::int64_t march10 = *parseStartDate("2024-03-10T00:00:00Z");
+        json week = aggregator.rolling("sport:Run", 7, march10);
+        check(week["num_activities"] == 2, "rolling week holds activities from mar 4 through mar 10");
+        check(week["metrics"]["distance"]["mean"] == 7500.0, "rolling week mean");
+        check(week["start"] == march10 - 6 * day && week["end"] == march10 + day, "rolling week bounds");
+
+        json weeks = aggregator.query("sport:Run", Granularity::Week, march10 - 14 * day, march10 + day);
+        check(weeks.size() == 2, "two calendar weeks");
+        check(weeks[0]["start"] == *parseStartDate("2024-02-26T00:00:00Z") && weeks[0]["num_activities"] == 1, "first week");
+        check(weeks[1]["metrics"]["distance"]["max"] == 10000.0, "second week max");
+
+        json route = aggregator.rolling("route:42", 30, march10);
+        check(route["num_activities"] == 2, "route scope holds mapped activities");
+
+        json series = aggregator.rollingSeries("sport:Run", 7, 3, march10);
+        check(series.size() == 3 && series[2]["num_activities"] == 0, "rolling series steps back by window");
+
+        bool threw = false;
+        try { aggregator.rolling("sport:Run", 0, march10); } catch (const std::invalid_argument&) { threw = true; }
+        check(threw, "rolling rejects empty window");
+        threw = false;
+        try { aggregator.rollingSeries("sport:Run", 7, 0, march10); } catch (const std::invalid_argument&) { threw = true; }
+        check(threw, "rolling series rejects zero windows");
+
+        json trend = aggregator.weeklyTrend("sport:Run", 2, march10);
+        check(trend == weeks, "weekly trend covers the calendar weeks ending at localEnd");
+        threw = false;
+        try { aggregator.weeklyTrend("sport:Run", 0, march10); } catch (const std::invalid_argument&) { threw = true; }
+        check(threw, "weekly trend rejects zero weeks");
+
+        json regenerated = {{"Run", {{{"route_id", 7}, {"ids", {1, 2}}, {"polyline", ""}}}}};
+        check(!aggregator.addRoutes(regenerated), "rejects remapping aggregated activities");
+        check(aggregator.rolling("route:42", 30, march10)["num_activities"] == 2, "rejected remap leaves route scope intact");
+        check(aggregator.addRoutes({{"Run", {{{"route_id", 42}, {"ids", {1, 2, 100}}, {"polyline", ""}}}}}), "accepts new activity ids on existing route");
+
+        Aggregator restored = Aggregator::fromJson(aggregator.toJson());
+        check(restored.rolling("route:42", 30, march10) == route, "aggregator survives json round trip");
+        check(!restored.addActivity(makeActivity(1, "2024-03-04T07:00:00Z", 5000)), "restored aggregator remembers seen ids");
+        check(restored.latestStart() == aggregator.latestStart(), "restored latest start");
+    }
+
+    void testIncrementalLoad() {
+        auto path = (std::filesystem::temp_directory_path() / "activity_aggregates_test.json").string();
+        json data = json::array({
+            makeActivity(10, "2024-01-01T08:00:00Z", 1000),
+            makeActivity(11, "2024-01-02T08:00:00Z", 2000)
+        });
+        {
+            std::ofstream outFile(path);
+            outFile << json{{"data", data}}.dump();
+        }
+
+        Aggregator aggregator {};
+        check(aggregator.loadActivities(path), "loads activity file");
+
+        // a late sync of an older activity is still folded in, exactly once
+        data.push_back(makeActivity(12, "2024-01-03T08:00:00Z", 3000));
+        data.push_back(makeActivity(13, "2023-12-01T08:00:00Z", 4000));
+        check(aggregator.addActivities(data) == 2, "adds unseen ids regardless of start time");
+        check(aggregator.addActivities(data) == 0, "second pass adds nothing");
+        std::filesystem::remove(path);
+    }
+
+    void testStateFile() {
+        auto path = (std::filesystem::temp_directory_path() / "activity_aggregates_state.json").string();
+
+        Aggregator aggregator {};
+        aggregator.addActivity(makeActivity(1, "2024-03-04T07:00:00Z", 5000));
+        check(aggregator.saveToFile(path), "saves state");
+        check(!std::filesystem::exists(path + ".tmp"), "temporary state file is renamed away");
+
+        auto loaded = Aggregator::loadFromFile(path);
+        check(loaded && loaded->latestStart() == aggregator.latestStart(), "loads saved state");
+
+        for (const std::string& corrupt : {std::string{"{\"seen_ids\":[]}"}, std::string{"{\"seen_"}}) {
+            std::ofstream outFile(path);
+            outFile << corrupt;
+            outFile.close();
+            check(!Aggregator::loadFromFile(path), "corrupt state file loads as empty: " + corrupt);
+        }
+
+        json state = aggregator.toJson();
+        state["series"]["sport:Run"]["day"][0]["metrics"]["distance"]["sketch"]["accuracy"] = 0.1;
+        {
+            std::ofstream outFile(path);
+            outFile << state.dump();
+        }
+        check(!Aggregator::loadFromFile(path), "state with a different sketch accuracy loads as empty");
+
+        std::filesystem::remove(path);
+    }
+}
+
+int main() {
+    testSketch();
+    testCalendar();
+    testAggregator();
+    testIncrementalLoad();
+    testStateFile();
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "all checks passed\n";
+    return 0;
+}